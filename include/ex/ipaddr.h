@@ -78,6 +78,14 @@ inline bool operator!=(const ex::ipaddr<ex::v4> &c1,
   return (c1.sockaddr.sin_port != c2.sockaddr.sin_port ||
           c1.sockaddr.sin_addr.s_addr != c2.sockaddr.sin_addr.s_addr);
 }
+// Orders addresses, e.g. to key them in a `std::map`.
+inline bool operator<(const ex::ipaddr<ex::v4> &c1,
+                      const ex::ipaddr<ex::v4> &c2) {
+  if (c1.sockaddr.sin_addr.s_addr != c2.sockaddr.sin_addr.s_addr)
+    return c1.sockaddr.sin_addr.s_addr < c2.sockaddr.sin_addr.s_addr;
+  return c1.sockaddr.sin_port < c2.sockaddr.sin_port;
+}
+
 inline bool operator==(const ex::ipaddr<ex::v6> &c1,
                        const ex::ipaddr<ex::v6> &c2) {
   return (c1.sockaddr.sin6_port == c2.sockaddr.sin6_port &&
@@ -95,4 +103,18 @@ inline bool operator!=(const ex::ipaddr<ex::v6> &c1,
           memcmp(&c1.sockaddr.sin6_addr, &c2.sockaddr.sin6_addr,
                  sizeof(c1.sockaddr.sin6_addr)) != 0);
 }
+
+// Orders addresses, e.g. to key them in a `std::map`.
+inline bool operator<(const ex::ipaddr<ex::v6> &c1,
+                      const ex::ipaddr<ex::v6> &c2) {
+  auto res = memcmp(&c1.sockaddr.sin6_addr, &c2.sockaddr.sin6_addr,
+                    sizeof(c1.sockaddr.sin6_addr));
+  if (res != 0)
+    return res < 0;
+  if (c1.sockaddr.sin6_port != c2.sockaddr.sin6_port)
+    return c1.sockaddr.sin6_port < c2.sockaddr.sin6_port;
+  if (c1.sockaddr.sin6_scope_id != c2.sockaddr.sin6_scope_id)
+    return c1.sockaddr.sin6_scope_id < c2.sockaddr.sin6_scope_id;
+  return c1.sockaddr.sin6_flowinfo < c2.sockaddr.sin6_flowinfo;
+}
 } // namespace ex
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace ex {
+
+// A token-bucket pacer which schedules departure times of datagrams.
+//
+// The pacer is limited by bytes per second and/or packets per second. A rate
+// of zero means unlimited. `burst_bytes` and `burst_packets` are the bucket
+// depths, i.e. how much more may leave back-to-back after a datagram before
+// pacing kicks in.
+class pacer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit pacer(double bytes_per_sec = 0, double packets_per_sec = 0,
+                 size_t burst_bytes = 0, size_t burst_packets = 0)
+      : m_bytes_per_sec(bytes_per_sec), m_packets_per_sec(packets_per_sec),
+        m_bytes_tolerance(per_sec(burst_bytes, bytes_per_sec)),
+        m_packets_tolerance(per_sec(burst_packets, packets_per_sec)) {}
+
+  // This function returns true if the pacer limits anything.
+  bool enabled() const { return m_bytes_per_sec > 0 || m_packets_per_sec > 0; }
+
+  // This function reserves `size` bytes and one packet from the bucket, and
+  // returns the time point at which the datagram is allowed to depart.
+  clock::time_point reserve(size_t size, clock::time_point now = clock::now()) {
+    auto departure = now;
+    if (m_bytes_per_sec > 0)
+      departure = std::max(departure, m_bytes_tat - m_bytes_tolerance);
+    if (m_packets_per_sec > 0)
+      departure = std::max(departure, m_packets_tat - m_packets_tolerance);
+
+    if (m_bytes_per_sec > 0)
+      m_bytes_tat = std::max(m_bytes_tat, departure) +
+                    per_sec(size, m_bytes_per_sec);
+    if (m_packets_per_sec > 0)
+      m_packets_tat = std::max(m_packets_tat, departure) +
+                      per_sec(1, m_packets_per_sec);
+    return departure;
+  }
+
+private:
+  static clock::duration per_sec(size_t n, double rate) {
+    if (rate <= 0)
+      return clock::duration::zero();
+    return std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(n / rate));
+  }
+
+  double m_bytes_per_sec;
+  double m_packets_per_sec;
+  clock::duration m_bytes_tolerance;
+  clock::duration m_packets_tolerance;
+  // Theoretical arrival times of the next datagram for each bucket.
+  clock::time_point m_bytes_tat{};
+  clock::time_point m_packets_tat{};
+};
+
+} // namespace ex
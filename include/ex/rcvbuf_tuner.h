@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace ex {
+
+// A decision made by `ex::rcvbuf_tuner`.
+struct rcvbuf_decision {
+  enum action_t { grow, shrink };
+  action_t action;
+  // The `SO_RCVBUF` value requested before and after the decision.
+  int old_size;
+  int new_size;
+  // The `SO_RCVBUF` value reported by the kernel after the decision, which may
+  // be capped by `net.core.rmem_max`.
+  int effective_size;
+  // The kernel drops observed since the previous evaluation.
+  uint32_t drops;
+  // The peak receive queue occupancy in bytes since the previous decision.
+  int occupancy;
+};
+
+// An auto-tuner of the receive buffer size, driven by kernel drop counts and
+// receive queue occupancy.
+//   - The buffer doubles when the kernel drops datagrams, and grows by half
+//   when the queue is more than 3/4 full.
+//   - The buffer halves after `shrink_after` consecutive evaluations without
+//   drops in which the queue stayed less than 1/4 full.
+//   - The buffer always stays within [`min_size`, `max_size`].
+class rcvbuf_tuner {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit rcvbuf_tuner(
+      int min_size, int max_size,
+      clock::duration interval = std::chrono::milliseconds(100),
+      int shrink_after = 50)
+      : m_min_size(min_size), m_max_size(std::max(min_size, max_size)),
+        m_interval(interval), m_shrink_after(shrink_after) {}
+
+  // This function clamps a buffer size to the configured bounds.
+  int clamp(int64_t size) const {
+    return (int)std::min(std::max(size, (int64_t)m_min_size),
+                         (int64_t)m_max_size);
+  }
+
+  // The time between two evaluations.
+  clock::duration interval() const { return m_interval; }
+
+  // This function evaluates one sample, where `size` is the requested buffer
+  // size, `limit` is the buffer size reported by the kernel, `drops` is the
+  // drop count since the previous evaluation and `occupancy` is the bytes
+  // currently queued.
+  //
+  // It returns true if the buffer size should change to `pending().new_size`,
+  // in which case the caller applies it and then calls `commit()`.
+  bool update(int size, int limit, uint32_t drops, int occupancy) {
+    m_peak = std::max(m_peak, occupancy);
+    m_drops += drops;
+
+    int new_size = size;
+    if (drops > 0) {
+      new_size = clamp((int64_t)size * 2);
+    } else if ((int64_t)occupancy * 4 >= (int64_t)limit * 3) {
+      new_size = clamp((int64_t)size + size / 2);
+    } else if ((int64_t)occupancy * 4 >= (int64_t)limit) {
+      // The queue is in use, so start counting quiet evaluations again.
+      m_idle = 0;
+    } else if (++m_idle >= m_shrink_after) {
+      new_size = clamp(size / 2);
+    }
+    if (drops > 0)
+      m_idle = 0;
+    if (new_size == size)
+      return false;
+
+    m_pending.action =
+        new_size > size ? rcvbuf_decision::grow : rcvbuf_decision::shrink;
+    m_pending.old_size = size;
+    m_pending.new_size = new_size;
+    m_pending.effective_size = limit;
+    m_pending.drops = drops;
+    m_pending.occupancy = m_peak;
+    m_peak = 0;
+    m_idle = 0;
+    return true;
+  }
+
+  // The decision returned by `update()`, before it is committed.
+  const rcvbuf_decision &pending() const { return m_pending; }
+
+  // This function records the buffer size reported by the kernel after the
+  // decision returned by `update()` has been applied.
+  //
+  // It returns false, and the decision is discarded, if the kernel did not
+  // change the buffer size, e.g. because `net.core.rmem_max` caps it.
+  bool commit(int effective_size) {
+    if (effective_size == m_pending.effective_size)
+      return false;
+    m_last = m_pending;
+    m_last.effective_size = effective_size;
+    if (m_last.action == rcvbuf_decision::grow)
+      ++m_grows;
+    else
+      ++m_shrinks;
+    return true;
+  }
+
+  // The last committed decision.
+  const rcvbuf_decision &last() const { return m_last; }
+
+  // The number of times the buffer has grown.
+  uint64_t grows() const { return m_grows; }
+
+  // The number of times the buffer has shrunk.
+  uint64_t shrinks() const { return m_shrinks; }
+
+  // The total kernel drops observed.
+  uint64_t drops() const { return m_drops; }
+
+private:
+  int m_min_size;
+  int m_max_size;
+  clock::duration m_interval;
+  int m_shrink_after;
+  int m_peak = 0;
+  int m_idle = 0;
+  uint64_t m_drops = 0;
+  uint64_t m_grows = 0;
+  uint64_t m_shrinks = 0;
+  rcvbuf_decision m_pending{};
+  rcvbuf_decision m_last{};
+};
+
+} // namespace ex
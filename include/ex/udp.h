@@ -1,9 +1,20 @@
 #pragma once
 #include <ex/buffer.h>
 #include "ipaddr.h"
+#include "pacer.h"
+#include "rcvbuf_tuner.h"
 #include "socket.h"
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <ex/shared_buffer.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
 
 #ifdef _WIN32
 #include <MSWSock.h>
@@ -14,6 +25,19 @@ auto const close = ::closesocket;
 #include <sys/socket.h>
 #include <unistd.h>
 
+#if defined(__linux__) && defined(SO_TXTIME)
+#define HAS_SO_TXTIME
+#include <linux/net_tstamp.h>
+#include <time.h>
+#endif
+
+#if defined(__linux__) && defined(SO_RXQ_OVFL)
+#define HAS_SO_RXQ_OVFL
+#include <linux/sock_diag.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#endif
+
 #endif
 
 namespace ex {
@@ -92,8 +116,17 @@ public:
   // be retrieved by using macro `ERRNO`.
   int recvfrom(uint8_t *recv_buffer, size_t recv_buffer_size,
                ipaddr<T> &rmt_ipaddr) {
+#ifdef HAS_SO_RXQ_OVFL
+    auto res = m_autotune->enabled
+                   ? m_recvfrom_rxq_ovfl(recv_buffer, recv_buffer_size,
+                                         rmt_ipaddr)
+                   : ::recvfrom(fd, recv_buffer, recv_buffer_size, 0,
+                                (sockaddr *)&rmt_ipaddr.sockaddr,
+                                &rmt_ipaddr.size);
+#else
     auto res = ::recvfrom(fd, CAST_CHAR_PTR recv_buffer, recv_buffer_size, 0,
                           (sockaddr *)&rmt_ipaddr.sockaddr, &rmt_ipaddr.size);
+#endif
 #ifdef USE_SOCKET_EXCEPTION
     if (res == -1)
       throw socket::exception("recvfrom failed.", ERRNO);
@@ -118,9 +151,7 @@ public:
   // ex::socket::exception if c++ exception enabled. The specific error code can
   // be retrieved by using macro `ERRNO`.
   int sendto(char const *str, const ipaddr<T> &dst_ipaddr) {
-    auto res =
-        ::sendto(fd, str, strlen(str), 0, (sockaddr *)&dst_ipaddr.sockaddr,
-                 sizeof(dst_ipaddr.sockaddr));
+    auto res = m_sendto(str, strlen(str), dst_ipaddr);
 #ifdef USE_SOCKET_EXCEPTION
     if (res == -1)
       throw socket::exception("sendto failed.", ERRNO);
@@ -136,9 +167,7 @@ public:
   // be retrieved by using macro `ERRNO`.
   template <typename U>
   int sendto(U *buf, size_t size, const ipaddr<T> &dst_ipaddr) {
-    auto res =
-        ::sendto(fd, CAST_CONST_CHAR_PTR buf, size, 0,
-                 (sockaddr *)&dst_ipaddr.sockaddr, sizeof(dst_ipaddr.sockaddr));
+    auto res = m_sendto(buf, size, dst_ipaddr);
 #ifdef USE_SOCKET_EXCEPTION
     if (res == -1)
       throw socket::exception("sendto failed.", ERRNO);
@@ -154,9 +183,7 @@ public:
   // be retrieved by using macro `ERRNO`.
   template <typename U>
   int sendto(const U &t, const ipaddr<T> &dst_ipaddr) const {
-    auto res =
-        ::sendto(fd, CAST_CONST_CHAR_PTR t.data(), t.size(), 0,
-                 (sockaddr *)&dst_ipaddr.sockaddr, sizeof(dst_ipaddr.sockaddr));
+    auto res = m_sendto(t.data(), t.size(), dst_ipaddr);
 #ifdef USE_SOCKET_EXCEPTION
     if (res == -1)
       throw socket::exception("sendto failed.", ERRNO);
@@ -171,9 +198,7 @@ public:
   // ex::socket::exception if c++ exception enabled. The specific error code can
   // be retrieved by using macro `ERRNO`.
   template <typename U> int sendto(U &&t, const ipaddr<T> &dst_ipaddr) const {
-    auto res =
-        ::sendto(fd, CAST_CONST_CHAR_PTR t.data(), t.size(), 0,
-                 (sockaddr *)&dst_ipaddr.sockaddr, sizeof(dst_ipaddr.sockaddr));
+    auto res = m_sendto(t.data(), t.size(), dst_ipaddr);
 #ifdef USE_SOCKET_EXCEPTION
     if (res == -1)
       throw socket::exception("sendto failed.", ERRNO);
@@ -191,9 +216,7 @@ public:
   int sendto(std::initializer_list<U> t, const ipaddr<T> &dst_ipaddr) {
     ex::buffer v(t.size());
     v.fill(t);
-    auto res =
-        ::sendto(fd, CAST_CONST_CHAR_PTR v.data(), t.size(), 0,
-                 (sockaddr *)&dst_ipaddr.sockaddr, sizeof(dst_ipaddr.sockaddr));
+    auto res = m_sendto(v.data(), t.size(), dst_ipaddr);
 #ifdef USE_SOCKET_EXCEPTION
     if (res == -1)
       throw socket::exception("sendto failed.", ERRNO);
@@ -306,6 +329,211 @@ public:
 #endif
   }
 
+  // This function enables paced transmission. Datagrams sent by `sendto()` are
+  // spread out to `bytes_per_sec` and/or `packets_per_sec` instead of leaving
+  // in bursts. A rate of zero means unlimited.
+  //   - `sendto()` sleeps until the departure time computed by a user-space
+  //   token bucket, unless kernel scheduling is enabled by `set_txtime()`.
+  //   - Pacing state is guarded by a mutex, so a paced socket may be shared by
+  //   several sender threads; they share the same token bucket.
+  //   - A paced `sendto()` blocks until the departure time, even on a
+  //   non-blocking socket, so do not call it from an event loop which must not
+  //   stall.
+  //   - Tokens are spent before the datagram is sent, so a failed `sendto()`
+  //   still delays the datagrams after it.
+  void set_pacing(double bytes_per_sec, double packets_per_sec = 0) {
+    set_pacing(pacer(bytes_per_sec, packets_per_sec));
+  }
+
+  // This function enables paced transmission with a custom token bucket.
+  void set_pacing(const pacer &p) {
+    std::lock_guard<std::mutex> lock(m_pacing->mutex);
+    m_pacing->socket_pacer = p;
+  }
+
+  // This function enables paced transmission to a specific destination. It
+  // takes precedence over the pacing of the socket, so rates of zero exempt
+  // the destination from pacing.
+  void set_pacing(const ipaddr<T> &dst_ipaddr, double bytes_per_sec,
+                  double packets_per_sec = 0) {
+    set_pacing(dst_ipaddr, pacer(bytes_per_sec, packets_per_sec));
+  }
+
+  // This function enables paced transmission to a specific destination with a
+  // custom token bucket.
+  void set_pacing(const ipaddr<T> &dst_ipaddr, const pacer &p) {
+    std::lock_guard<std::mutex> lock(m_pacing->mutex);
+    m_pacing->dst_pacers.insert_or_assign(dst_ipaddr, p);
+  }
+
+  // This function disables the pacing of a specific destination, which falls
+  // back to the pacing of the socket.
+  void clear_pacing(const ipaddr<T> &dst_ipaddr) {
+    std::lock_guard<std::mutex> lock(m_pacing->mutex);
+    m_pacing->dst_pacers.erase(dst_ipaddr);
+  }
+
+  // This function disables paced transmission and kernel scheduling.
+  //
+  // *NOTE: The kernel offers no way to clear `SO_TXTIME` from a socket, so
+  // once `set_txtime()` has succeeded, every datagram keeps carrying a
+  // departure time (the current time plus the offset given to `set_txtime()`
+  // when unpaced).
+  void clear_pacing() {
+    std::lock_guard<std::mutex> lock(m_pacing->mutex);
+    m_pacing->socket_pacer = pacer();
+    m_pacing->dst_pacers.clear();
+    m_pacing->txtime = false;
+  }
+
+  // This function hands the departure time of paced datagrams to the kernel
+  // through `SO_TXTIME`, so that `sendto()` only sleeps until shortly before
+  // it. `clockid` should be `CLOCK_MONOTONIC` for the fq qdisc (default), or
+  // `CLOCK_TAI` for etf.
+  //   - The kernel accepts `SO_TXTIME` whatever the qdisc is, but only fq and
+  //   etf enforce it. Only enable it when one of them is on the egress path,
+  //   otherwise datagrams leave in bursts.
+  //   - Datagrams are never stamped earlier than `offset` from now. fq sends
+  //   late datagrams at once, but etf drops them, so with etf `offset` must be
+  //   positive and cover the etf `delta` plus the time to reach the qdisc.
+  //
+  // If no error occurs, this function returns zero. Otherwise, it returns a
+  // value of SOCKET_ERROR if c++ exception disabled, or it throws an
+  // ex::socket::exception if c++ exception enabled. The specific error code can
+  // be retrieved by using macro `ERRNO`.
+  //
+  // *NOTE: Do nothing except on Linux.
+  int set_txtime() {
+#ifdef HAS_SO_TXTIME
+    return set_txtime(CLOCK_MONOTONIC);
+#else
+    return 0;
+#endif
+  }
+
+  // See `set_txtime()`.
+  //
+  // *NOTE: Do nothing except on Linux.
+  int set_txtime(int clockid, std::chrono::nanoseconds offset =
+                                  std::chrono::nanoseconds::zero()) {
+#ifdef HAS_SO_TXTIME
+    sock_txtime cfg;
+    cfg.clockid = clockid;
+    cfg.flags = 0;
+    auto res = setsockopt(SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg));
+    if (res == -1)
+      return res;
+    std::lock_guard<std::mutex> lock(m_pacing->mutex);
+    m_pacing->txtime = true;
+    m_pacing->txtime_armed = true;
+    m_pacing->txtime_clock = clockid;
+    m_pacing->txtime_offset = offset;
+    return res;
+#else
+    (void)clockid;
+    (void)offset;
+    return 0;
+#endif
+  }
+
+  // This function returns true if paced datagrams are scheduled by the kernel
+  // through `SO_TXTIME`, or false if they are paced in user space.
+  bool txtime() const {
+    std::lock_guard<std::mutex> lock(m_pacing->mutex);
+    return m_pacing->txtime;
+  }
+
+  // This function enables auto-tuning of the receive buffer size within
+  // [`min_size`, `max_size`]. `recvfrom()` periodically checks the kernel drop
+  // count (`SO_RXQ_OVFL`) and the receive queue occupancy, and grows or shrinks
+  // `SO_RCVBUF` accordingly. See `ex::rcvbuf_tuner` for the policy.
+  //   - `on_decision` is called after each change, e.g. to feed metrics. It is
+  //   called from `recvfrom()`, outside of any lock.
+  //   - Tuning state is guarded by a mutex and shared by copies of the socket,
+  //   so several threads may receive on it.
+  //   - Sizes beyond `net.core.rmem_max` are capped by the kernel.
+  //
+  // If no error occurs, this function returns zero. Otherwise, it returns a
+  // value of SOCKET_ERROR if c++ exception disabled, or it throws an
+  // ex::socket::exception if c++ exception enabled. The specific error code can
+  // be retrieved by using macro `ERRNO`.
+  //
+  // *NOTE: Do nothing except on Linux.
+  int set_recv_buffer_autotune(
+      int min_size, int max_size,
+      std::function<void(const rcvbuf_decision &)> on_decision = nullptr) {
+    return set_recv_buffer_autotune(rcvbuf_tuner(min_size, max_size),
+                                    std::move(on_decision));
+  }
+
+  // This function enables auto-tuning of the receive buffer size with a custom
+  // tuner.
+  //
+  // *NOTE: Do nothing except on Linux.
+  int set_recv_buffer_autotune(
+      const rcvbuf_tuner &tuner,
+      std::function<void(const rcvbuf_decision &)> on_decision = nullptr) {
+#ifdef HAS_SO_RXQ_OVFL
+    // Apply the initial size first, so that a failure leaves auto-tuning off.
+    // Linux reports twice the requested size.
+    auto res = set_recv_buffer_size(tuner.clamp(m_rcvbuf_limit() / 2));
+    if (res == -1)
+      return res;
+    int n = 1;
+    res = setsockopt(SOL_SOCKET, SO_RXQ_OVFL, &n, sizeof(n));
+    if (res == -1)
+      return res;
+
+    std::lock_guard<std::mutex> lock(m_autotune->mutex);
+    m_autotune->tuner = tuner;
+    m_autotune->on_decision = std::move(on_decision);
+    // `SO_RXQ_OVFL` reports the cumulative drops of the socket, so only count
+    // those from now on.
+    auto drops = m_meminfo(SK_MEMINFO_DROPS);
+    m_autotune->drops = m_autotune->drops_seen =
+        drops > 0 ? (uint32_t)drops : 0;
+    m_autotune->size = m_rcvbuf_limit() / 2;
+    m_autotune->next = rcvbuf_tuner::clock::now();
+    m_autotune->enabled = true;
+    return res;
+#else
+    (void)tuner;
+    (void)on_decision;
+    return 0;
+#endif
+  }
+
+  // This function disables auto-tuning of the receive buffer size. The buffer
+  // keeps its current size.
+  void clear_recv_buffer_autotune() {
+    std::lock_guard<std::mutex> lock(m_autotune->mutex);
+#ifdef HAS_SO_RXQ_OVFL
+    if (m_autotune->enabled) {
+      int n = 0;
+      ::setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &n, sizeof(n));
+    }
+#endif
+    m_autotune->enabled = false;
+    m_autotune->tuner.reset();
+    m_autotune->on_decision = nullptr;
+    m_autotune->drops = 0;
+    m_autotune->drops_seen = 0;
+  }
+
+  // A snapshot of the receive buffer auto-tuner, which holds the last decision
+  // and the counters, or `std::nullopt` if auto-tuning is disabled.
+  std::optional<rcvbuf_tuner> recv_buffer_tuner() const {
+    std::lock_guard<std::mutex> lock(m_autotune->mutex);
+    return m_autotune->tuner;
+  }
+
+  // The number of datagrams dropped by the kernel on this socket, as last
+  // reported by `SO_RXQ_OVFL`. It is only updated while auto-tuning is enabled.
+  uint32_t recv_drops() const {
+    std::lock_guard<std::mutex> lock(m_autotune->mutex);
+    return m_autotune->drops;
+  }
+
   // This function closes an existing socket.
   // If no error occurs, this function returns zero. Otherwise, it returns a
   // value of SOCKET_ERROR if c++ exception disabled, or it throws an
@@ -338,9 +566,227 @@ public:
   }
 
 private:
+  // With `SO_TXTIME`, `sendto()` still sleeps until this long before the
+  // departure time, so that the qdisc does not queue unbounded.
+  static constexpr auto txtime_lead = std::chrono::milliseconds(2);
+
+  struct pacing {
+    std::mutex mutex;
+    pacer socket_pacer;
+    std::map<ipaddr<T>, pacer> dst_pacers;
+    // Whether paced datagrams are scheduled by the kernel.
+    bool txtime = false;
+    // Whether `SO_TXTIME` has been set on the socket, which cannot be undone.
+    bool txtime_armed = false;
+    int txtime_clock = 0;
+    std::chrono::nanoseconds txtime_offset{};
+  };
+
+  // The pacer of a destination, or nullptr if it is not paced. The caller
+  // holds `m_pacing->mutex`.
+  pacer *m_pacer_of(const ipaddr<T> &dst_ipaddr) const {
+    auto it = m_pacing->dst_pacers.find(dst_ipaddr);
+    if (it != m_pacing->dst_pacers.end())
+      return it->second.enabled() ? &it->second : nullptr;
+    auto &p = m_pacing->socket_pacer;
+    return p.enabled() ? &p : nullptr;
+  }
+
+  auto m_sendto(const void *buf, size_t size,
+                const ipaddr<T> &dst_ipaddr) const {
+    std::unique_lock<std::mutex> lock(m_pacing->mutex);
+    auto p = m_pacer_of(dst_ipaddr);
+    auto departure = p ? p->reserve(size) : pacer::clock::now();
+#ifdef HAS_SO_TXTIME
+    auto txtime = m_pacing->txtime;
+    auto txtime_armed = m_pacing->txtime_armed;
+    auto txtime_clock = m_pacing->txtime_clock;
+    auto txtime_offset = m_pacing->txtime_offset;
+#endif
+    lock.unlock();
+
+    if (p) {
+#ifdef HAS_SO_TXTIME
+      std::this_thread::sleep_until(txtime ? departure - txtime_lead
+                                           : departure);
+#else
+      std::this_thread::sleep_until(departure);
+#endif
+    }
+#ifdef HAS_SO_TXTIME
+    if (txtime_armed)
+      return m_sendto_txtime(buf, size, dst_ipaddr, departure, txtime_clock,
+                             txtime_offset);
+#endif
+    return ::sendto(fd, CAST_CONST_CHAR_PTR buf, size, 0,
+                    (sockaddr *)&dst_ipaddr.sockaddr,
+                    sizeof(dst_ipaddr.sockaddr));
+  }
+
+#ifdef HAS_SO_TXTIME
+  ssize_t m_sendto_txtime(const void *buf, size_t size,
+                          const ipaddr<T> &dst_ipaddr,
+                          pacer::clock::time_point departure,
+                          int txtime_clock,
+                          std::chrono::nanoseconds offset) const {
+    // Translate the departure time to the clock of `SO_TXTIME`, no earlier
+    // than `offset` from now.
+    struct timespec ts;
+    clock_gettime(txtime_clock, &ts);
+    auto now = pacer::clock::now();
+    auto delay = std::max(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(departure - now),
+        offset);
+    int64_t txtime =
+        (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + delay.count();
+
+    char control[CMSG_SPACE(sizeof(txtime))] = {0};
+    struct iovec iov;
+    iov.iov_base = const_cast<void *>(buf);
+    iov.iov_len = size;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *)&dst_ipaddr.sockaddr;
+    msg.msg_namelen = sizeof(dst_ipaddr.sockaddr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_TXTIME;
+    cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+    memcpy(CMSG_DATA(cm), &txtime, sizeof(txtime));
+    return ::sendmsg(fd, &msg, 0);
+  }
+#endif
+
+  struct autotune {
+    std::mutex mutex;
+    // Lets `recvfrom()` skip the lock while auto-tuning is disabled.
+    std::atomic<bool> enabled{false};
+    std::optional<rcvbuf_tuner> tuner;
+    std::function<void(const rcvbuf_decision &)> on_decision;
+    // The requested `SO_RCVBUF` value, resynced to what the kernel applied.
+    int size = 0;
+    rcvbuf_tuner::clock::time_point next{};
+    uint32_t drops = 0;
+    uint32_t drops_seen = 0;
+  };
+
+#ifdef HAS_SO_RXQ_OVFL
+  ssize_t m_recvfrom_rxq_ovfl(uint8_t *recv_buffer, size_t recv_buffer_size,
+                              ipaddr<T> &rmt_ipaddr) {
+    char control[CMSG_SPACE(sizeof(uint32_t))];
+    struct iovec iov;
+    iov.iov_base = recv_buffer;
+    iov.iov_len = recv_buffer_size;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &rmt_ipaddr.sockaddr;
+    msg.msg_namelen = rmt_ipaddr.size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto res = ::recvmsg(fd, &msg, 0);
+    auto err = errno;
+
+    bool has_drops = false;
+    uint32_t drops = 0;
+    if (res != -1) {
+      rmt_ipaddr.size = msg.msg_namelen;
+      for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+          memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+          has_drops = true;
+        }
+      }
+    }
+
+    std::function<void(const rcvbuf_decision &)> on_decision;
+    rcvbuf_decision decision;
+    {
+      std::lock_guard<std::mutex> lock(m_autotune->mutex);
+      if (m_autotune->tuner) {
+        // Threads may report the counter out of order, so never go back.
+        if (has_drops && (int32_t)(drops - m_autotune->drops) > 0)
+          m_autotune->drops = drops;
+        if (m_autotune_recv_buffer()) {
+          on_decision = m_autotune->on_decision;
+          decision = m_autotune->tuner->last();
+        }
+      }
+    }
+    if (on_decision)
+      on_decision(decision);
+    errno = err;
+    return res;
+  }
+
+  // This function evaluates the tuner once per interval, and returns true if
+  // it changed the buffer size. The caller holds `m_autotune->mutex`.
+  bool m_autotune_recv_buffer() {
+    auto &at = *m_autotune;
+    auto now = rcvbuf_tuner::clock::now();
+    if (now < at.next)
+      return false;
+    at.next = now + at.tuner->interval();
+
+    uint32_t drops = at.drops - at.drops_seen;
+    at.drops_seen = at.drops;
+    if (!at.tuner->update(at.size, m_rcvbuf_limit(), drops,
+                          m_recv_queue_bytes()))
+      return false;
+
+    int size = at.tuner->pending().new_size;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    // Resync to what the kernel applied, which `net.core.rmem_max` may cap.
+    auto limit = m_rcvbuf_limit();
+    at.size = limit / 2;
+    return at.tuner->commit(limit);
+  }
+
+  // The `SO_RCVBUF` value reported by the kernel.
+  int m_rcvbuf_limit() const {
+    int n = 0;
+    socklen_t len = sizeof(n);
+    ::getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &n, &len);
+    return n;
+  }
+
+  // A `SO_MEMINFO` counter, or -1 if it is unavailable.
+  int64_t m_meminfo(int i) const {
+#ifdef SO_MEMINFO
+    uint32_t meminfo[SK_MEMINFO_VARS] = {0};
+    socklen_t len = sizeof(meminfo);
+    if (::getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0 &&
+        (size_t)i < len / sizeof(meminfo[0]))
+      return meminfo[i];
+#else
+    (void)i;
+#endif
+    return -1;
+  }
+
+  // The bytes held by the receive queue. `SIOCINQ` only reports the size of
+  // the first datagram on UDP sockets, so `SO_MEMINFO` is preferred.
+  int m_recv_queue_bytes() const {
+    auto n = m_meminfo(SK_MEMINFO_RMEM_ALLOC);
+    if (n >= 0)
+      return (int)n;
+    int inq = 0;
+    ::ioctl(fd, SIOCINQ, &inq);
+    return inq;
+  }
+#endif
+
   ex::buffer m_recv_buffer;
   int m_recv_buffer_len = 0;
   ipaddr<T> m_rmt_ipaddr;
+  // Shared by copies of the socket, as they share the file descriptor.
+  std::shared_ptr<pacing> m_pacing = std::make_shared<pacing>();
+  std::shared_ptr<autotune> m_autotune = std::make_shared<autotune>();
 };
 
 } // namespace ex
\ No newline at end of file
@@ -1,7 +1,10 @@
 #include "ex/socket.h"
 #include "ex/buffer.h"
 #include "ex/ipaddr.h"
+#include "ex/pacer.h"
+#include "ex/rcvbuf_tuner.h"
 #include <cassert>
+#include <climits>
 #include <cstdio>
 #include <ex/udp.h>
 #include <iostream>
@@ -28,8 +31,112 @@ int main() {
   assert(i6a1 != i6a3);
   assert(i6a1 == i6a4);
 
+  assert(!(ia1 < ia4) && !(ia4 < ia1));
+  assert((ia1 < ia2) != (ia2 < ia1));
+  assert((ia1 < ia3) != (ia3 < ia1));
+  assert(!(i6a1 < i6a4) && !(i6a4 < i6a1));
+  assert((i6a1 < i6a2) != (i6a2 < i6a1));
+  assert((i6a1 < i6a3) != (i6a3 < i6a1));
+
   std::cout << "IP Pass!" << std::endl;
 
+  {
+    auto t0 = ex::pacer::clock::time_point() + 1s;
+
+    ex::pacer unlimited;
+    assert(!unlimited.enabled());
+    assert(unlimited.reserve(1000, t0) == t0);
+
+    // 1000 bytes/s: 100 bytes are spaced by 100ms.
+    ex::pacer bytes(1000);
+    assert(bytes.enabled());
+    assert(bytes.reserve(100, t0) == t0);
+    assert(bytes.reserve(100, t0) == t0 + 100ms);
+    assert(bytes.reserve(100, t0) == t0 + 200ms);
+    // Idle time is not saved up without burst tolerance.
+    assert(bytes.reserve(100, t0 + 2s) == t0 + 2s);
+    assert(bytes.reserve(100, t0 + 2s) == t0 + 2s + 100ms);
+
+    // 10 packets/s.
+    ex::pacer packets(0, 10);
+    assert(packets.reserve(1000, t0) == t0);
+    assert(packets.reserve(1, t0) == t0 + 100ms);
+
+    // The stricter limit wins.
+    ex::pacer both(1000, 100);
+    assert(both.reserve(200, t0) == t0);
+    assert(both.reserve(1, t0) == t0 + 200ms);
+    assert(both.reserve(1, t0) == t0 + 210ms);
+
+    // 300 more bytes may follow the first datagram back-to-back.
+    ex::pacer burst(1000, 0, 300);
+    for (int i = 0; i < 4; ++i)
+      assert(burst.reserve(100, t0) == t0);
+    assert(burst.reserve(100, t0) == t0 + 100ms);
+  }
+
+  std::cout << "Pacer Pass!" << std::endl;
+
+  {
+    // Drops double the buffer.
+    ex::rcvbuf_tuner drops(4096, 65536);
+    assert(drops.update(4096, 8192, 5, 0));
+    assert(drops.pending().action == ex::rcvbuf_decision::grow);
+    assert(drops.pending().new_size == 8192);
+    assert(drops.commit(16384));
+    assert(drops.last().effective_size == 16384);
+    assert(drops.last().drops == 5);
+    assert(drops.grows() == 1 && drops.drops() == 5);
+
+    // A queue more than 3/4 full grows the buffer by half.
+    ex::rcvbuf_tuner occupancy(4096, 65536);
+    assert(!occupancy.update(8192, 16384, 0, 12287));
+    assert(occupancy.update(8192, 16384, 0, 12288));
+    assert(occupancy.pending().new_size == 12288);
+
+    // Quiet rounds shrink the buffer by half.
+    ex::rcvbuf_tuner quiet(4096, 65536, 100ms, 3);
+    assert(!quiet.update(16384, 32768, 0, 1000));
+    assert(!quiet.update(16384, 32768, 0, 8191));
+    assert(quiet.update(16384, 32768, 0, 0));
+    assert(quiet.pending().action == ex::rcvbuf_decision::shrink);
+    assert(quiet.pending().new_size == 8192);
+    assert(quiet.pending().occupancy == 8191);
+    assert(quiet.commit(16384) && quiet.shrinks() == 1);
+    // A busy round restarts the count, but does not block shrinking.
+    ex::rcvbuf_tuner busy(4096, 65536, 100ms, 3);
+    assert(!busy.update(16384, 32768, 0, 0));
+    assert(!busy.update(16384, 32768, 0, 0));
+    assert(!busy.update(16384, 32768, 0, 16000));
+    assert(!busy.update(16384, 32768, 0, 0));
+    assert(!busy.update(16384, 32768, 0, 0));
+    assert(busy.update(16384, 32768, 0, 0));
+    assert(busy.pending().new_size == 8192);
+    assert(busy.pending().occupancy == 16000);
+
+    // The bounds are never crossed.
+    ex::rcvbuf_tuner bounds(4096, 65536, 100ms, 1);
+    assert(bounds.update(49152, 98304, 1, 0));
+    assert(bounds.pending().new_size == 65536);
+    assert(!bounds.update(65536, 131072, 1, 0));
+    assert(bounds.update(6144, 12288, 0, 0));
+    assert(bounds.pending().new_size == 4096);
+    assert(!bounds.update(4096, 8192, 0, 0));
+
+    // A decision the kernel does not apply is discarded.
+    ex::rcvbuf_tuner capped(4096, 1 << 30);
+    assert(capped.update(106496, 212992, 1, 0));
+    assert(!capped.commit(212992));
+    assert(capped.grows() == 0);
+
+    // Large sizes do not overflow.
+    ex::rcvbuf_tuner large(4096, INT_MAX);
+    assert(large.update(3 << 29, INT_MAX, 1, 0));
+    assert(large.pending().new_size == INT_MAX);
+  }
+
+  std::cout << "Tuner Pass!" << std::endl;
+
   ex::socket::startup();
 
   std::vector<std::thread> threads;
@@ -51,7 +158,7 @@ int main() {
             printf("%02x ", buffer[j]);
           std::cout << std::endl;
         } catch (ex::socket::exception &e) {
-          std::cout << e.code << ": " << e.msg << std::endl;
+          std::cout << e.code << ": " << e.what() << std::endl;
         }
       }
 